@@ -4,8 +4,6 @@ set -ex
 
 rm -rf out
 mkdir out
-pushd out >/dev/null
+cd out
 
-g++ -Wall -Wextra -pedantic -std=c++20 -O2 -o main.exe ../main.cpp
-
-popd >/dev/null
+g++ -Wall -Wextra -pedantic -std=c++20 -O2 -pthread -o main ../main.cpp